@@ -7,24 +7,341 @@
 // histogram operations
 
 // define histograms
-TH1F *hrqdc[32];    //raw
-TH1F *hcqdc[32];    //cut on thresh, overflow
-TH1F *hQTh[32];
-TH1F *hrun;
-TH1F *hMultip0;
-TH1F *hMultip1;
-TH1F *hMultip2;
-TH1F *hMultip3;
-TH1F *hMultip4;
-TH1F *hMultip5;
-TH1D *hiDet;
-
-TH1F *ht1;
+// Each RunSet gets its own set so that several sets can be cast at once
+struct VetoHists
+{
+  TH1F *hrqdc[32];    //raw
+  TH1F *hcqdc[32];    //cut on thresh, overflow
+  TH1F *hQTh[32];
+  TH1F *hrun;
+  TH1F *hMultip0;
+  TH1F *hMultip1;
+  TH1F *hMultip2;
+  TH1F *hMultip3;
+  TH1F *hMultip4;
+  TH1F *hMultip5;
+  TH1D *hiDet;
+
+  TH1F *ht1;
+};
+
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include <Math/Vavilov.h>
 
+#include "vetoQDCFit.h"
+
 using namespace std;
 
+// Canvases and gStyle are not thread safe, only one set may plot at a time
+std::mutex gPlotMutex;
+
+// Create a fresh set of histograms
+void bookHists(VetoHists& h)
+{
+	static Int_t nqdc_bins=80;
+	static Float_t ll_qdc=0.;
+	static Float_t ul_qdc=4200.;
+	Char_t hname[50];
+	for (Int_t i=0; i<32; i++)
+	{
+		sprintf(hname,"hrqdc%d",i);
+		h.hrqdc[i]=new TH1F(hname,hname,nqdc_bins,ll_qdc,ul_qdc);
+		h.hrqdc[i]->SetMarkerColor(3);
+		sprintf(hname,"hcqdc%d",i);
+		h.hcqdc[i]=new TH1F(hname,hname,nqdc_bins,ll_qdc,ul_qdc);
+    h.hQTh[i]=new TH1F(hname,hname,nqdc_bins,ll_qdc,ul_qdc);
+		h.hcqdc[i]->Sumw2();
+    h.hQTh[i]->Sumw2();
+	}
+
+   	h.hrun = new TH1F("hrun", "run numbers", 1000, 0, 30000);
+   	h.hMultip0 = new TH1F("hMultip0", "Multiplicity", 33, -0.5, 32.5);
+   	h.hMultip1 = new TH1F("hMultip1", "Multiplicity", 33, -0.5, 32.5);
+   	h.hMultip2 = new TH1F("hMultip2", "Multiplicity", 33, -0.5, 32.5);
+   	h.hMultip3 = new TH1F("hMultip3", "Multiplicity", 33, -0.5, 32.5);
+   	h.hMultip4 = new TH1F("hMultip4", "Multiplicity", 33, -0.5, 32.5);
+   	h.hMultip5 = new TH1F("hMultip5", "Multiplicity", 33, -0.5, 32.5);
+
+	h.hiDet = new TH1D("hiDet","hiDet",145,0.,144);
+
+	// counts vs time hist
+	// limits are in seconds relative to 1/1/95
+	// one hour bins = 16667
+	// one day bins = 695
+	h.ht1 = new TH1F("ht1","ht1",695,640000000,750000000);
+	h.ht1->GetXaxis()->SetTimeDisplay(1);
+}
+
+// Add every histogram of "from" onto "into"
+void addHists(VetoHists& into, const VetoHists& from)
+{
+  for (int i = 0; i < 32; i++)
+  {
+    into.hrqdc[i]->Add(from.hrqdc[i]);
+    into.hcqdc[i]->Add(from.hcqdc[i]);
+    into.hQTh[i]->Add(from.hQTh[i]);
+  }
+  into.hrun->Add(from.hrun);
+  into.hMultip0->Add(from.hMultip0);
+  into.hMultip1->Add(from.hMultip1);
+  into.hMultip2->Add(from.hMultip2);
+  into.hMultip3->Add(from.hMultip3);
+  into.hMultip4->Add(from.hMultip4);
+  into.hMultip5->Add(from.hMultip5);
+  into.hiDet->Add(from.hiDet);
+  into.ht1->Add(from.ht1);
+}
+
+void deleteHists(VetoHists& h)
+{
+  for (int i = 0; i < 32; i++)
+  {
+    delete h.hrqdc[i];
+    delete h.hcqdc[i];
+    delete h.hQTh[i];
+  }
+  delete h.hrun;
+  delete h.hMultip0;
+  delete h.hMultip1;
+  delete h.hMultip2;
+  delete h.hMultip3;
+  delete h.hMultip4;
+  delete h.hMultip5;
+  delete h.hiDet;
+  delete h.ht1;
+}
+
+// Every histogram of a set with the key it is saved under. hcqdc and hQTh share their names, so they can't be saved by name
+void listHists(VetoHists& h, vector<pair<string, TH1*>>& hists)
+{
+  Char_t key[50];
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(key, "hrqdc%d", i);
+    hists.push_back(make_pair(string(key), (TH1*)h.hrqdc[i]));
+    sprintf(key, "hcqdc%d", i);
+    hists.push_back(make_pair(string(key), (TH1*)h.hcqdc[i]));
+    sprintf(key, "hQTh%d", i);
+    hists.push_back(make_pair(string(key), (TH1*)h.hQTh[i]));
+  }
+  hists.push_back(make_pair(string("hrun"), (TH1*)h.hrun));
+  hists.push_back(make_pair(string("hMultip0"), (TH1*)h.hMultip0));
+  hists.push_back(make_pair(string("hMultip1"), (TH1*)h.hMultip1));
+  hists.push_back(make_pair(string("hMultip2"), (TH1*)h.hMultip2));
+  hists.push_back(make_pair(string("hMultip3"), (TH1*)h.hMultip3));
+  hists.push_back(make_pair(string("hMultip4"), (TH1*)h.hMultip4));
+  hists.push_back(make_pair(string("hMultip5"), (TH1*)h.hMultip5));
+  hists.push_back(make_pair(string("hiDet"), (TH1*)h.hiDet));
+  hists.push_back(make_pair(string("ht1"), (TH1*)h.ht1));
+}
+
+void writeHists(VetoHists& h, TDirectory* dir)
+{
+  vector<pair<string, TH1*>> hists;
+  listHists(h, hists);
+  for (size_t i = 0; i < hists.size(); i++)
+  {
+    dir->WriteObject(hists[i].second, hists[i].first.c_str());
+  }
+}
+
+// Adds the histograms saved by writeHists onto booked ones. Nothing is added unless all of them are there
+bool readHists(VetoHists& h, TDirectory* dir)
+{
+  vector<pair<string, TH1*>> hists;
+  listHists(h, hists);
+  vector<TH1*> saved(hists.size(), nullptr);
+  bool ok = true;
+  for (size_t i = 0; i < hists.size() && ok; i++)
+  {
+    dir->GetObject(hists[i].first.c_str(), saved[i]);
+    ok = (saved[i] != nullptr && saved[i]->GetNbinsX() == hists[i].second->GetNbinsX());
+  }
+  for (size_t i = 0; i < hists.size(); i++)
+  {
+    if (ok) hists[i].second->Add(saved[i]);
+    delete saved[i];
+  }
+  return ok;
+}
+
+// Keeps new histograms out of gDirectory for a scope, then puts TH1::AddDirectory back the way the caller had it
+class HistDirectoryGuard
+{
+public:
+  HistDirectoryGuard() : status(TH1::AddDirectoryStatus()) {TH1::AddDirectory(kFALSE);}
+  ~HistDirectoryGuard() {TH1::AddDirectory(status);}
+
+private:
+  bool status;
+};
+
+// Bind every histogram to its VetoHists alone, whatever gDirectory is and whatever TH1::AddDirectory says
+void detachHists(VetoHists& h)
+{
+  vector<pair<string, TH1*>> hists;
+  listHists(h, hists);
+  for (size_t i = 0; i < hists.size(); i++)
+  {
+    hists[i].second->SetDirectory(nullptr);
+  }
+}
+
+// Empty every histogram for the next set, dropping contents, errors, statistics and fits but keeping the binning
+void resetHists(VetoHists& h)
+{
+  vector<pair<string, TH1*>> hists;
+  listHists(h, hists);
+  for (size_t i = 0; i < hists.size(); i++)
+  {
+    hists[i].second->Reset();
+  }
+}
+
+// Booked sets of histograms handed out empty and taken back once a set is done with them. Only as many are
+// ever booked as are in use at once (a worker's set, its event threads' chunks, the plot stage), so memory stays
+// the same whether 13 sets are cast or several hundred. The pool owns every histogram it books and deletes them
+// when it goes; anything handed out must be given back before then
+class HistPool
+{
+public:
+  HistPool() {}
+  ~HistPool()
+  {
+    for (size_t i = 0; i < booked.size(); i++)
+    {
+      deleteHists(booked[i]);
+    }
+  }
+
+  VetoHists Acquire()
+  {
+    {
+      lock_guard<mutex> lock(poolMutex);
+      if (!idle.empty())
+      {
+        VetoHists h = idle.back();
+        idle.pop_back();
+        return h; //Reset when it was given back
+      }
+    }
+    VetoHists h;
+    bookHists(h); //Booked outside the lock, several threads may be booking
+    detachHists(h);
+    lock_guard<mutex> lock(poolMutex);
+    booked.push_back(h);
+    return h;
+  }
+
+  void Release(VetoHists& h)
+  {
+    resetHists(h);
+    lock_guard<mutex> lock(poolMutex);
+    idle.push_back(h);
+  }
+
+  size_t GetBooked()
+  {
+    lock_guard<mutex> lock(poolMutex);
+    return booked.size();
+  }
+
+private:
+  HistPool(const HistPool&);
+  HistPool& operator=(const HistPool&);
+
+  vector<VetoHists> booked; //Everything the pool owns
+  vector<VetoHists> idle; //Booked, empty and free to hand out
+  mutex poolMutex;
+};
+
+// The contents, errors and statistics of the 32 hcqdc of a set, held as plain arrays with no histogram objects,
+// so sums of them cost a few tens of kB however many sets go in. Bins are whole counts, so the sum comes out
+// the same in any order, exactly as adding the histograms themselves would
+struct QDCSnapshot
+{
+  int nBins; //Per channel, with the underflow and overflow bins. 0 until something is added
+  vector<double> content; //32 x nBins
+  vector<double> sumw2;
+  double stats[32][4]; //sumw, sumw2, sumwx, sumwx2, as TH1::GetStats gives them
+  double entries[32];
+
+  QDCSnapshot() : nBins(0) {}
+
+  void Add(TH1F* const hists[32])
+  {
+    if (nBins == 0) Size(hists[0]->GetNbinsX() + 2);
+    for (int c = 0; c < 32; c++)
+    {
+      const TArrayD* w2 = hists[c]->GetSumw2();
+      for (int b = 0; b < nBins; b++)
+      {
+        content[c * nBins + b] += hists[c]->GetBinContent(b);
+        sumw2[c * nBins + b] += (w2->GetSize() == nBins) ? w2->At(b) : hists[c]->GetBinContent(b);
+      }
+      Double_t s[TH1::kNstat];
+      hists[c]->GetStats(s);
+      for (int k = 0; k < 4; k++) stats[c][k] += s[k];
+      entries[c] += hists[c]->GetEntries();
+    }
+  }
+
+  void Add(const QDCSnapshot& other)
+  {
+    if (other.nBins == 0) return;
+    if (nBins == 0) Size(other.nBins);
+    for (size_t i = 0; i < content.size(); i++)
+    {
+      content[i] += other.content[i];
+      sumw2[i] += other.sumw2[i];
+    }
+    for (int c = 0; c < 32; c++)
+    {
+      for (int k = 0; k < 4; k++) stats[c][k] += other.stats[c][k];
+      entries[c] += other.entries[c];
+    }
+  }
+
+  // Fill empty histograms of the same binning, with Sumw2 on, with the sum
+  void CopyTo(TH1F* const hists[32]) const
+  {
+    for (int c = 0; c < 32 && nBins > 0; c++)
+    {
+      for (int b = 0; b < nBins; b++)
+      {
+        hists[c]->SetBinContent(b, content[c * nBins + b]);
+        hists[c]->GetSumw2()->SetAt(sumw2[c * nBins + b], b);
+      }
+      Double_t s[TH1::kNstat] = {0};
+      for (int k = 0; k < 4; k++) s[k] = stats[c][k];
+      hists[c]->PutStats(s);
+      hists[c]->SetEntries(entries[c]);
+    }
+  }
+
+  bool IsEmpty() const {return nBins == 0;}
+
+private:
+  void Size(int bins)
+  {
+    nBins = bins;
+    content.assign(32 * nBins, 0.);
+    sumw2.assign(32 * nBins, 0.);
+    for (int c = 0; c < 32; c++)
+    {
+      for (int k = 0; k < 4; k++) stats[c][k] = 0.;
+      entries[c] = 0.;
+    }
+  }
+};
+
 // without fitting
 // void plotQDCs(string savePath)
 // {
@@ -102,8 +419,9 @@ using namespace std;
 //
 // }
 
-// fitting
-void plotQDCs(string savePath)
+// with the landau fits of hcqdc made by fitQDCs(), drawn with them rather than fit here.
+// Fits and colours go on the drawn copies, the canvas deletes them; the histograms themselves are left as booked
+void plotQDCs(VetoHists& h, const QDCFit fits[32], string savePath)
 {
   	bool HistView = true;
   	//if (!(gROOT->IsBatch()) && HistView)
@@ -122,17 +440,17 @@ void plotQDCs(string savePath)
     for(Int_t i=0; i<2; i++)  // 2 centerd in row 1
     {
       vcan0->cd(i+2);
-      hrqdc[i+17]->Draw();
+      h.hrqdc[i+17]->Draw();
     }
     for(Int_t i=0; i<2; i++)  // 2 centerd in row 2
     {
       vcan0->cd(i+6);
-      hrqdc[i+20]->Draw();
+      h.hrqdc[i+20]->Draw();
     }
     for(Int_t i=0; i<16; i++)  // bottom 4 rows
     {
       vcan0->cd(i+21);
-      hrqdc[i]->Draw();
+      h.hrqdc[i]->Draw();
     }
 		TCanvas *vcan1 = new TCanvas("vcan1","thresh cut veto QDC",50,0,500,625);
 		gStyle->SetOptStat("e");
@@ -150,28 +468,22 @@ void plotQDCs(string savePath)
     for(Int_t i=0; i<2; i++)  // 2 centerd in row 1
     {
       vcan1->cd(i+2);
-      hcqdc[i+17]->Fit("landau");
-      hcqdc[i+17]->Draw();
-      hQTh[i+17]->SetLineColor(3);
-      hQTh[i+17]->Draw("SAME HIST");
+      attachQDCFit((TH1F*)h.hcqdc[i+17]->DrawCopy(), fits[i+17]);
+      h.hQTh[i+17]->DrawCopy("SAME HIST")->SetLineColor(3);
       vcan1->Update();
     }
     for(Int_t i=0; i<2; i++)  // 2 centerd in row 2
     {
       vcan1->cd(i+6);
-      hcqdc[i+20]->Fit("landau");
-      hcqdc[i+20]->Draw();
-      hQTh[i+20]->SetLineColor(3);
-      hQTh[i+20]->Draw("SAME HIST");
+      attachQDCFit((TH1F*)h.hcqdc[i+20]->DrawCopy(), fits[i+20]);
+      h.hQTh[i+20]->DrawCopy("SAME HIST")->SetLineColor(3);
       vcan1->Update();
     }
     for(Int_t i=0; i<12; i++)
     {
       vcan1->cd(i+9);
-      hcqdc[i]->Fit("landau");
-      hcqdc[i]->Draw();
-      hQTh[i]->SetLineColor(3);
-      hQTh[i]->Draw("SAME HIST");
+      attachQDCFit((TH1F*)h.hcqdc[i]->DrawCopy(), fits[i]);
+      h.hQTh[i]->DrawCopy("SAME HIST")->SetLineColor(3);
       vcan1->Update();
     }
     // for(Int_t i=0; i<12; i++)  // bottom 4 rows
@@ -187,13 +499,14 @@ void plotQDCs(string savePath)
 
     std::cout << "Call to save/print qdc" << std::endl;
 		vcan1->Print(savePath.append("_Thresh_Fit.pdf").c_str(),"pdf");
-		vcan0->~TCanvas();
+		delete vcan1;
+		delete vcan0;
 
 }
 
 
 
-void plotMultip(string savePath)
+void plotMultip(VetoHists& h, string savePath)
 {
   	bool HistView = true;
   	//if (!(gROOT->IsBatch()) && HistView)
@@ -203,6 +516,8 @@ void plotMultip(string savePath)
 		//mcan0->cd(1);
     		gStyle->SetOptStat(0);
 
+		//Styled on the drawn copy, which the canvas deletes, so a pooled hMultip0 keeps its booked title and range
+		TH1* hMultip0 = h.hMultip0->DrawCopy();
     		hMultip0->SetXTitle("Veto Panel Multiplicity");
     		hMultip0->SetTitle("");
     		hMultip0->GetXaxis()->SetTitleOffset(1.2);
@@ -214,7 +529,6 @@ void plotMultip(string savePath)
 		//mcan0->cd();
    		//hMultip0->GetXaxis()->SetRange(2,32);
    		//hMultip0->GetXaxis()->SetRangeUser(2,32);
-		hMultip0->Draw();
 
 		//mcan0->cd(2);
 		//hMultip1->Draw();
@@ -231,15 +545,17 @@ void plotMultip(string savePath)
 		std::cout << "Call to save/print multips" << std::endl;
 		mcan0->Print(savePath.append(".pdf").c_str(),"pdf");
 		//mcan0->Print(savePath + ".pdf","pdf");
+		delete mcan0;
 		//}
 }
 
-void plotTimeHists()
+void plotTimeHists(VetoHists& h)
 {
   	bool HistView = true;
   	if (!(gROOT->IsBatch()) && HistView)
 	{
   		TCanvas *tcan0 = new TCanvas("tcan0","time sequence",100,0,800,800);
+		TH1* ht1 = h.ht1->DrawCopy(); //Left on the canvas, which owns it
 		ht1->GetXaxis()->SetLabelSize(0.02);
     		ht1->SetXTitle("Date");
 	 	ht1->SetYTitle("Muon Event Count");
@@ -247,76 +563,262 @@ void plotTimeHists()
 	    	ht1->GetYaxis()->SetTitleOffset(1.5);
   	 	ht1->GetXaxis()->CenterTitle();
     		ht1->GetYaxis()->CenterTitle();
-		ht1->Draw();
 	}
 }
 
 //-------------------------------------------------------------------------------------------------------------------------
-int PanelMap(int qdcChan, int runNum)
+// Panel geometry
+//
+// For Dave and Bradley.
+// Using the 32-panel configuration as "standard", map the QDC index to a physical panel location for all of the run ranges.
+// The figure "Veto Panels, View From The Top" in Veto System Change Log is the map I use for ALL configurations.
+//
+// Each run range is resolved once into a flat channel -> panel table plus bitmasks (bit = QDC channel)
+// of the channels that sit on the top, bottom-x and bottom-y panels, so the event loop never builds a map.
+// Extra or corrected ranges can be given in PANEL_CONFIG_FILE_NAME without recompiling, one range per line:
+//   firstRun lastRun panel(qdc 0) panel(qdc 1) ... panel(qdc 31)
+// with panels numbered 1-32, -1 for an unused channel, and # starting a comment. Ranges in the file are checked
+// before the built-in ones. A line without exactly 32 channels, with its runs out of order or with any other
+// panel number is skipped.
+
+const string PANEL_CONFIG_FILE_NAME = "veto-panel-config.txt";
+
+const int MAX_PANEL_NUMBER = 32; //Panels are numbered 1 to 32, -1 marks an unused channel
+const int numTopPanels = 4;
+const int numBotXPanels = 6;
+const int numBotYPanels = 6;
+const int topPanelNumbers [numTopPanels] = {18, 19, 21, 22}; //Panel numbers that are on top
+const int botXPanelNumbers [numBotXPanels] = {1, 2, 3, 4, 5, 6}; //Panel numbers that are on bottom in x-direction
+const int botYPanelNumbers [numBotYPanels] = {7, 8, 9, 10, 11, 12}; //Panel numbers that are on bottom in y-direction
+
+struct PanelConfig
 {
-	// For Dave and Bradley.
-	// Using the 32-panel configuration as "standard", map the QDC index to a physical panel location for all of the run ranges.
-	// The figure "Veto Panels, View From The Top" in Veto System Change Log is the map I use for ALL configurations.
-	// key: "qdc channel"  value: "panel location"
+  int firstRun; //Inclusive run range this configuration covers
+  int lastRun;
+  int panel[32]; //key: "qdc channel"  value: "panel location"
+  unsigned int topMask; //Channels on a top panel
+  unsigned int botXMask; //Channels on a bottom panel along x
+  unsigned int botYMask; //Channels on a bottom panel along y
+};
 
-	map<int,int> panels;
+vector<PanelConfig> gPanelConfigs; //Filled once by loadPanelConfigs(), read only while casting
 
-	// 32-panel config (default) - began 7/10/15
-	if (runNum < 45000000 && runNum >= 3057) {
-		map<int,int> tempMap =
-		{{0,1},  {1,2},  {2,3},  {3,4}, {4,5}, {5,6},
-		 {6,7},  {7,8},  {8,9},  {9,10}, {10,11}, {11,12},
-		 {12,13}, {13,14}, {14,15}, {15,16},
-		 {16,17}, {17,18}, {18,19}, {19,20},
-		 {20,21}, {21,22}, {22,23}, {23,24},
-		 {24,25}, {25,26}, {26,27}, {27,28},
-		 {28,29}, {29,30}, {30,31}, {31,32}};
-		panels = tempMap;
+// Used when no range covers a run: every channel maps to -1 and no channel is in a group
+const PanelConfig UNKNOWN_PANEL_CONFIG = {0, -1,
+	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}, 0, 0, 0};
+
+// Fill in the group masks from the channel -> panel table
+void resolvePanelMasks(PanelConfig& config)
+{
+  config.topMask = 0;
+  config.botXMask = 0;
+  config.botYMask = 0;
+  for (int c = 0; c < 32; c++)
+  {
+    for (int i = 0; i < numTopPanels; i++)
+      if (config.panel[c] == topPanelNumbers[i]) config.topMask |= (1u << c);
+    for (int i = 0; i < numBotXPanels; i++)
+      if (config.panel[c] == botXPanelNumbers[i]) config.botXMask |= (1u << c);
+    for (int i = 0; i < numBotYPanels; i++)
+      if (config.panel[c] == botYPanelNumbers[i]) config.botYMask |= (1u << c);
+  }
+}
+
+void addPanelConfig(int firstRun, int lastRun, const int panel[32])
+{
+  PanelConfig config;
+  config.firstRun = firstRun;
+  config.lastRun = lastRun;
+  for (int c = 0; c < 32; c++) config.panel[c] = panel[c];
+  resolvePanelMasks(config);
+  gPanelConfigs.push_back(config);
+}
+
+// Read the optional config file, then add the built-in run ranges
+void loadPanelConfigs(string configPath = PANEL_CONFIG_FILE_NAME)
+{
+	gPanelConfigs.clear();
+
+	ifstream configFile(configPath.c_str());
+	string line;
+	while (getline(configFile, line))
+	{
+	  if (line.find('#') != string::npos) line.erase(line.find('#'));
+	  istringstream fields(line);
+	  int firstRun, lastRun, panel[32];
+	  if (!(fields >> firstRun >> lastRun)) continue; //Blank or comment line
+	  int c = 0;
+	  while (c < 32 && fields >> panel[c]) c++;
+	  string extra;
+	  if (c < 32 || fields >> extra)
+	  {
+	    cout << "Skipping panel config line without exactly 32 channels: " << line << endl;
+	    continue;
+	  }
+	  if (firstRun > lastRun)
+	  {
+	    cout << "Skipping panel config line whose first run is after its last: " << line << endl;
+	    continue;
+	  }
+	  bool panelsOk = true;
+	  for (c = 0; c < 32; c++)
+	  {
+	    panelsOk = panelsOk && (panel[c] == -1 || (panel[c] >= 1 && panel[c] <= MAX_PANEL_NUMBER));
+	  }
+	  if (!panelsOk)
+	  {
+	    cout << "Skipping panel config line with a panel number that isn't -1 or 1-" << MAX_PANEL_NUMBER << ": " << line << endl;
+	    continue;
+	  }
+	  addPanelConfig(firstRun, lastRun, panel);
 	}
+	if (gPanelConfigs.size() > 0)
+	  cout << "Read " << gPanelConfigs.size() << " panel configurations from " << configPath << endl;
+
+	// 32-panel config (default) - began 7/10/15
+	const int panels32[32] =
+		{1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15, 16,
+		 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32};
+	addPanelConfig(3057, 44999999, panels32);
+
 	// 1st prototype config (24 panels)
-	else if (runNum >= 45000509 && runNum <= 45004116) {
-		map<int,int> tempMap =
-		{{0,1},  {1,2},  {2,3},  {3,4}, {4,5}, {5,6},
-		 {6,7},  {7,8},  {8,9},  {9,10}, {10,11}, {11,12},
-		 {12,21}, {13,22}, {14,15}, {15,16},
-		 {16,17}, {17,18}, {18,19}, {19,20},
-		 {20,13}, {21,14}, {22,23}, {23,24},
-		 {24,-1}, {25,-1}, {26,-1}, {27,-1},
-		 {28,-1}, {29,-1}, {30,-1}, {31,-1}};
-		 panels = tempMap;
-	}
+	const int panelsProto1[32] =
+		{1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 21, 22, 15, 16,
+		 17, 18, 19, 20, 13, 14, 23, 24, -1, -1, -1, -1, -1, -1, -1, -1};
+	addPanelConfig(45000509, 45004116, panelsProto1);
+
 	// 2nd prototype config (24 panels)
-	else if (runNum >= 45004117 && runNum <= 45008659) {
-		map<int,int> tempMap =
-		{{0,1},  {1,2},  {2,3},  {3,4}, {4,5}, {5,6},
-		 {6,7},  {7,8},  {8,9},  {9,10}, {10,11}, {11,12},
-		 {12,13}, {13,14}, {14,15}, {15,16},
-		 {16,17}, {17,18}, {18,19}, {19,20},
-		 {20,21}, {21,22}, {22,23}, {23,24},
-		 {24,-1}, {25,-1}, {26,-1}, {27,-1},
-		 {28,-1}, {29,-1}, {30,-1}, {31,-1}};
-		 panels = tempMap;
-	}
+	const int panels24[32] =
+		{1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15, 16,
+		 17, 18, 19, 20, 21, 22, 23, 24, -1, -1, -1, -1, -1, -1, -1, -1};
+	addPanelConfig(45004117, 45008659, panels24);
+
 	// 1st module 1 (P3JDY) config, 6/24/15 - 7/7/15
-	else if (runNum > 0 && runNum <=3056){
-		map<int,int> tempMap =
-		{{0,1},  {1,2},  {2,3},  {3,4}, {4,5}, {5,6},
-		 {6,7},  {7,8},  {8,9},  {9,10}, {10,11}, {11,12},
-		 {12,13}, {13,14}, {14,15}, {15,16},
-		 {16,17}, {17,18}, {18,19}, {19,20},
-		 {20,21}, {21,22}, {22,23}, {23,24},
-		 {24,-1}, {25,-1}, {26,-1}, {27,-1},
-		 {28,-1}, {29,-1}, {30,-1}, {31,-1}};
-		 panels = tempMap;
-	}
-	else {
-		cout << "Panel map not known for this run number!\n";
-		return -1;
-	}
-	int panel = -1;
-	auto search = panels.find(qdcChan);
-	if(search != panels.end()) panel=search->second;
-	return panel;
+	addPanelConfig(1, 3056, panels24);
+}
+
+// Configuration covering this run, or nullptr if the panel map is not known for it
+const PanelConfig* FindPanelConfig(int runNum)
+{
+  for (size_t i = 0; i < gPanelConfigs.size(); i++)
+  {
+    if (runNum >= gPanelConfigs[i].firstRun && runNum <= gPanelConfigs[i].lastRun) return &gPanelConfigs[i];
+  }
+  return nullptr;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------
+
+// Hit classification
+//
+// One pass over the 32 channels gives a hit mask (bit c set when fQDC[c] >= fSWThresh[c]).
+// Everything downstream works from the mask and the PanelConfig group masks with popcounts.
+
+// Reference version, the same comparison the event loop always made
+inline unsigned int HitMaskScalar(const int* qdc, const int* thresh)
+{
+  unsigned int mask = 0;
+  for (int c = 0; c < 32; c++)
+  {
+    if (qdc[c] >= thresh[c]) mask |= (1u << c);
+  }
+  return mask;
+}
+
+// The same mask from eight (AVX2) or four (SSE2) channels a compare. Both are built on any x86 compiler
+// that takes target attributes, whatever flags the caster is built with, so vetoHitMaskTest.C can check
+// each of them on a CPU that has it
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VETO_HIT_MASK_KERNELS 1
+
+__attribute__((target("avx2"))) inline unsigned int HitMaskAVX2(const int* qdc, const int* thresh)
+{
+  unsigned int mask = 0;
+  for (int c = 0; c < 32; c += 8)
+  {
+    __m256i q = _mm256_loadu_si256((const __m256i*)(qdc + c));
+    __m256i t = _mm256_loadu_si256((const __m256i*)(thresh + c));
+    unsigned int below = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(t, q))); //thresh > qdc
+    mask |= (~below & 0xFFu) << c;
+  }
+  return mask;
+}
+
+__attribute__((target("sse2"))) inline unsigned int HitMaskSSE2(const int* qdc, const int* thresh)
+{
+  unsigned int mask = 0;
+  for (int c = 0; c < 32; c += 4)
+  {
+    __m128i q = _mm_loadu_si128((const __m128i*)(qdc + c));
+    __m128i t = _mm_loadu_si128((const __m128i*)(thresh + c));
+    unsigned int below = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(t, q))); //thresh > qdc
+    mask |= (~below & 0xFu) << c;
+  }
+  return mask;
+}
+#endif
+
+// The widest kernel the caster was built for
+inline unsigned int HitMask(const int* qdc, const int* thresh)
+{
+#if defined(VETO_HIT_MASK_KERNELS) && defined(__AVX2__)
+  return HitMaskAVX2(qdc, thresh);
+#elif defined(VETO_HIT_MASK_KERNELS) && defined(__SSE2__)
+  return HitMaskSSE2(qdc, thresh);
+#else
+  return HitMaskScalar(qdc, thresh);
+#endif
+}
+
+inline int countHits(unsigned int mask) {return __builtin_popcount(mask);}
+
+// Compare the mask based classification of one event against the original per-channel loops.
+// Returns false (and says why) on any difference. Used when DO_HIT_MASK_CHECK is on.
+bool checkHitMask(const int* qdc, const int* thresh, const PanelConfig& panels)
+{
+  unsigned int hitMask = HitMask(qdc, thresh);
+
+  bool atLeastOne = false;
+  vector<int> hitTracker;
+  for (int o = 0; o < 32; o++)
+  {
+    if (qdc[o] >= thresh[o])
+    {
+      atLeastOne = true;
+      hitTracker.push_back(panels.panel[o]);
+    }
+  }
+  int numBotXHits = 0, numBotYHits = 0, numTopHits = 0;
+  for (unsigned int hitIndex = 0; hitIndex < hitTracker.size(); hitIndex++)
+  {
+    for (int i = 0; i < numBotXPanels; i++) numBotXHits += (botXPanelNumbers[i] == hitTracker[hitIndex]) ? 1 : 0;
+    for (int i = 0; i < numBotYPanels; i++) numBotYHits += (botYPanelNumbers[i] == hitTracker[hitIndex]) ? 1 : 0;
+    for (int i = 0; i < numTopPanels; i++) numTopHits += (topPanelNumbers[i] == hitTracker[hitIndex]) ? 1 : 0;
+  }
+
+  bool ok = (hitMask == HitMaskScalar(qdc, thresh))
+    && (atLeastOne == (hitMask != 0))
+    && ((int)hitTracker.size() == countHits(hitMask))
+    && (numBotXHits == countHits(hitMask & panels.botXMask))
+    && (numBotYHits == countHits(hitMask & panels.botYMask))
+    && (numTopHits == countHits(hitMask & panels.topMask));
+
+  //Hit panels come out in channel order either way
+  unsigned int m = hitMask;
+  for (unsigned int hitIndex = 0; ok && hitIndex < hitTracker.size(); hitIndex++, m &= m - 1)
+  {
+    ok = (hitTracker[hitIndex] == panels.panel[__builtin_ctz(m)]);
+  }
+
+  if (!ok)
+  {
+    cout << "Hit mask check failed: mask 0x" << hex << hitMask << " scalar 0x" << HitMaskScalar(qdc, thresh) << dec
+         << " top " << numTopHits << "/" << countHits(hitMask & panels.topMask)
+         << " botX " << numBotXHits << "/" << countHits(hitMask & panels.botXMask)
+         << " botY " << numBotYHits << "/" << countHits(hitMask & panels.botYMask) << endl;
+  }
+  return ok;
 }
 //-------------------------------------------------------------------------------------------------------------------------
 
@@ -0,0 +1,187 @@
+//
+// vetoEntryIndex.h
+//
+// used by vetoAnaCaster.C, after vetoEventCache.h
+//
+// A small sidecar per skim (skimVeto_*.vindex) holding the run table and the lists of entries in each
+// selection class, so a pass that only needs the four-panel muons reads just those entries.
+// It is keyed by the skim's path, size and mtime, and rebuilt whenever any of them change.
+//
+//-------------------------------------------------------------------------------------------------------------------------
+
+// File layout, version ENTRY_INDEX_VERSION, native byte order:
+//   EntryIndexHeader
+//   source path   pathLength chars
+//   segments      nSegments x EntryIndexSegment
+//   entry lists   nFourPanel, nHighMultip x Long64_t, each in entry order
+// Segments are split the same way as in the event cache: consecutive entries sharing run, start and scalerDuration.
+
+const string ENTRY_INDEX_EXTENSION = ".vindex";
+const char ENTRY_INDEX_MAGIC[8] = {'M', 'J', 'D', 'V', 'E', 'T', 'O', 'I'};
+const UInt_t ENTRY_INDEX_VERSION = 2;
+
+struct EntryIndexHeader
+{
+  char magic[8];
+  UInt_t version;
+  UInt_t highMultipThreshold;
+  Long64_t sourceSize;
+  Long64_t sourceMtime;
+  Long64_t pathLength;
+  Long64_t nSegments;
+  Long64_t nFourPanel;
+  Long64_t nHighMultip;
+};
+
+struct EntryIndexSegment
+{
+  Long64_t firstEntry;
+  Long64_t nEvents; //Every event of the segment, whatever its class
+  Long64_t start;
+  double scalerDuration;
+  Int_t run;
+  Int_t pad;
+};
+
+struct VetoEntryIndex
+{
+  string sourcePath;
+  Long64_t sourceSize;
+  Long64_t sourceMtime;
+  UInt_t highMultipThreshold;
+
+  vector<EntryIndexSegment> segments; //Run table, in entry order
+  vector<Long64_t> fourPanelEntries; //CoinType[1] && fMultip == 4
+  vector<Long64_t> highMultipEntries; //CoinType[0] && fMultip >= highMultipThreshold
+
+  Long64_t GetEntries() const
+  {
+    return segments.empty() ? 0 : segments.back().firstEntry + segments.back().nEvents;
+  }
+
+  // Position in segments of the segment holding an entry
+  size_t SegmentOf(Long64_t entry) const
+  {
+    size_t lo = 0, hi = segments.size();
+    while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (segments[mid].firstEntry <= entry) lo = mid;
+      else hi = mid;
+    }
+    return lo;
+  }
+
+  bool Write(const string& indexPath) const
+  {
+    EntryIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ENTRY_INDEX_MAGIC, 8);
+    header.version = ENTRY_INDEX_VERSION;
+    header.highMultipThreshold = highMultipThreshold;
+    header.sourceSize = sourceSize;
+    header.sourceMtime = sourceMtime;
+    header.pathLength = sourcePath.size();
+    header.nSegments = segments.size();
+    header.nFourPanel = fourPanelEntries.size();
+    header.nHighMultip = highMultipEntries.size();
+
+    return writeFileAtomically(indexPath, [&](FILE* out)
+    {
+      return fwrite(&header, sizeof(header), 1, out) == 1
+        && fwrite(sourcePath.data(), 1, sourcePath.size(), out) == sourcePath.size()
+        && fwrite(segments.data(), sizeof(EntryIndexSegment), segments.size(), out) == segments.size()
+        && fwrite(fourPanelEntries.data(), sizeof(Long64_t), fourPanelEntries.size(), out) == fourPanelEntries.size()
+        && fwrite(highMultipEntries.data(), sizeof(Long64_t), highMultipEntries.size(), out) == highMultipEntries.size();
+    });
+  }
+
+  // Read an index, false if it is missing, damaged, or was made from something other than this exact skim
+  bool Read(const string& indexPath, const string& path, Long64_t size, Long64_t mtime, UInt_t threshold)
+  {
+    FILE* in = fopen(indexPath.c_str(), "rb");
+    if (in == nullptr) return false;
+    EntryIndexHeader header;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1
+      && memcmp(header.magic, ENTRY_INDEX_MAGIC, 8) == 0
+      && header.version == ENTRY_INDEX_VERSION
+      && header.highMultipThreshold == threshold
+      && header.sourceSize == size
+      && header.sourceMtime == mtime
+      && header.pathLength == (Long64_t)path.size();
+    if (ok)
+    {
+      sourcePath.resize(header.pathLength);
+      segments.resize(header.nSegments);
+      fourPanelEntries.resize(header.nFourPanel);
+      highMultipEntries.resize(header.nHighMultip);
+      ok = fread(&sourcePath[0], 1, sourcePath.size(), in) == sourcePath.size()
+        && sourcePath == path
+        && fread(segments.data(), sizeof(EntryIndexSegment), segments.size(), in) == segments.size()
+        && fread(fourPanelEntries.data(), sizeof(Long64_t), fourPanelEntries.size(), in) == fourPanelEntries.size()
+        && fread(highMultipEntries.data(), sizeof(Long64_t), highMultipEntries.size(), in) == highMultipEntries.size();
+    }
+    fclose(in);
+    sourceSize = size;
+    sourceMtime = mtime;
+    highMultipThreshold = threshold;
+    return ok;
+  }
+};
+
+// Classify every entry a source gives into a fresh index
+template <class Source>
+void buildEntryIndex(Source& source, VetoEntryIndex& index)
+{
+  index.segments.clear();
+  index.fourPanelEntries.clear();
+  index.highMultipEntries.clear();
+
+  VetoEventRow ev;
+  Long64_t entry = 0;
+  while (source.Next(ev))
+  {
+    if (index.segments.empty() || ev.run != index.segments.back().run || ev.start != index.segments.back().start
+        || memcmp(&ev.scalerDuration, &index.segments.back().scalerDuration, sizeof(double)) != 0)
+    {
+      EntryIndexSegment seg = {entry, 0, ev.start, ev.scalerDuration, ev.run, 0};
+      index.segments.push_back(seg);
+    }
+    index.segments.back().nEvents++;
+
+    if (ev.CoinType[1] && ev.fMultip == 4) index.fourPanelEntries.push_back(entry);
+    if (ev.CoinType[0] && ev.fMultip >= (int)index.highMultipThreshold) index.highMultipEntries.push_back(entry);
+    entry++;
+  }
+}
+
+// Load the index for a skim, rebuilding it from the cache (when given) or the tree if it is missing or stale
+bool openEntryIndex(const string& sourcePath, Long64_t nEntries, UInt_t threshold, const VetoEventCache* cache, VetoEntryIndex& index)
+{
+  Long64_t sourceSize = 0, sourceMtime = 0;
+  if (!fileStamp(sourcePath, sourceSize, sourceMtime)) return false;
+
+  string indexPath = sidecarPathFor(sourcePath, ENTRY_INDEX_EXTENSION);
+  if (index.Read(indexPath, sourcePath, sourceSize, sourceMtime, threshold)) return true;
+
+  cout << "Building entry index " << indexPath << endl;
+  index.sourcePath = sourcePath;
+  index.sourceSize = sourceSize;
+  index.sourceMtime = sourceMtime;
+  index.highMultipThreshold = threshold;
+  if (cache != nullptr)
+  {
+    CacheEventSource source(*cache, 0, nEntries);
+    buildEntryIndex(source, index);
+  }
+  else
+  {
+    TreeEventSource source(sourcePath, 0, nEntries);
+    buildEntryIndex(source, index);
+  }
+  if (index.GetEntries() != nEntries) return false;
+  if (!index.Write(indexPath)) cout << "Could not write entry index " << indexPath << ", using it for this pass only" << endl;
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,434 @@
+//
+// vetoEventCache.h
+//
+// used by vetoAnaCaster.C
+//
+// Event sources for the ana() event loop. An event is read either straight from the skim's vetoTree
+// or from a packed cache file holding only the fields the loop uses, memory mapped so re-analyses
+// skip ROOT's decompression and deserialization. Each event is still unpacked into a VetoEventRow.
+//
+//-------------------------------------------------------------------------------------------------------------------------
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TTreeReader.h"
+#include "TTreeReaderValue.h"
+#include "TTreeReaderArray.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include "vetoSidecar.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// The fields of one vetoTree entry that the event loop reads
+struct VetoEventRow
+{
+  int run;
+  Long64_t start;
+  double scalerDuration;
+  int fMultip;
+  bool CoinType[4];
+  int fQDC[32];
+  int fSWThresh[32];
+};
+
+//-------------------------------------------------------------------------------------------------------------------------
+// Reads entries [firstEntry, lastEntry) of a skim's vetoTree, binding only the branches the loop uses
+class TreeEventSource
+{
+public:
+  TreeEventSource(const string& path, Long64_t firstEntry, Long64_t lastEntry)
+    : file(TFile::Open(path.c_str())), reader("vetoTree", file.get()),
+      run(reader, "run"), start(reader, "start"), scalerDuration(reader, "scalerDuration"),
+      fMultip(reader, "fMultip"), fQDC(reader, "fQDC[32]"), fSWThresh(reader, "fSWThresh[32]"),
+      CoinType(reader, "CoinType")
+  {
+    reader.SetEntriesRange(firstEntry, lastEntry);
+  }
+
+  bool Next(VetoEventRow& ev)
+  {
+    if (!file || !reader.Next()) return false;
+    Fill(ev);
+    return true;
+  }
+
+  // Jump to one entry, for passes that only read the entries listed in an index
+  bool ReadEntry(Long64_t entry, VetoEventRow& ev)
+  {
+    if (!file || reader.SetEntry(entry) != TTreeReader::kEntryValid) return false;
+    Fill(ev);
+    return true;
+  }
+
+  // Bytes read from the skim so far, compressed, as ROOT counts them
+  Long64_t GetBytesRead() const {return file ? file->GetBytesRead() : 0;}
+
+private:
+  void Fill(VetoEventRow& ev)
+  {
+    ev.run = *run;
+    ev.start = *start;
+    ev.scalerDuration = *scalerDuration;
+    ev.fMultip = *fMultip;
+    //CoinType[0]: "weak" muon candidate.  2 or more panels fired over 500QDC
+    //CoinType[1]: "strong" muon candidate.  Require 2 top + 2 bottom coincidence
+    //CoinType[2]: both planes of a side + both bottom planes (edited)
+    //CoinType[3]: both top planes + both planes of a side
+    for (int k = 0; k < 4; k++) ev.CoinType[k] = CoinType[k];
+    for (int c = 0; c < 32; c++)
+    {
+      ev.fQDC[c] = fQDC[c];
+      ev.fSWThresh[c] = fSWThresh[c];
+    }
+  }
+
+  unique_ptr<TFile> file; //Declared first so it is closed after the reader is gone
+  TTreeReader reader;
+  TTreeReaderValue<Int_t> run;
+  TTreeReaderValue<Long64_t> start;
+  TTreeReaderValue<double> scalerDuration;
+  TTreeReaderValue<Int_t> fMultip;
+  TTreeReaderArray<int> fQDC;
+  TTreeReaderArray<int> fSWThresh;
+  TTreeReaderArray<int> CoinType; //[32]
+};
+
+//-------------------------------------------------------------------------------------------------------------------------
+// Cache file layout, version EVENT_CACHE_VERSION, native byte order:
+//   EventCacheHeader
+//   fMultip       nEvents x Short_t
+//   CoinType      nEvents x UChar_t, bit k set when CoinType[k] was nonzero
+//   fQDC          nEvents x 32 x UShort_t
+//   fSWThresh     nEvents x 32 x UShort_t
+//   segments      nSegments x EventCacheSegment
+// Each column starts on a 64 byte boundary. A segment is a run of consecutive entries with the same
+// run, start and scalerDuration, so those are stored once per segment instead of once per event.
+// The header records the size and mtime of the skim it was made from so a stale cache is rebuilt.
+
+const string EVENT_CACHE_EXTENSION = ".vcache";
+const char EVENT_CACHE_MAGIC[8] = {'M', 'J', 'D', 'V', 'E', 'T', 'O', 'C'};
+const UInt_t EVENT_CACHE_VERSION = 1;
+
+struct EventCacheHeader
+{
+  char magic[8];
+  UInt_t version;
+  UInt_t headerSize;
+  Long64_t sourceSize;
+  Long64_t sourceMtime;
+  Long64_t nEvents;
+  Long64_t nSegments;
+  Long64_t multipOffset;
+  Long64_t coinOffset;
+  Long64_t qdcOffset;
+  Long64_t threshOffset;
+  Long64_t segmentOffset;
+};
+
+struct EventCacheSegment
+{
+  Long64_t firstEntry;
+  Long64_t start;
+  double scalerDuration;
+  Int_t run;
+  Int_t pad;
+};
+
+Long64_t alignCacheOffset(Long64_t offset) {return (offset + 63) & ~(Long64_t)63;}
+
+//-------------------------------------------------------------------------------------------------------------------------
+// Memory mapped, read only view of a cache file
+class VetoEventCache
+{
+public:
+  VetoEventCache() : mapped(nullptr), mappedSize(0), header(nullptr) {}
+  ~VetoEventCache() {Close();}
+
+  // Map the cache, false if it is missing, damaged, from another version or older than its skim
+  bool Open(const string& cachePath, Long64_t sourceSize, Long64_t sourceMtime)
+  {
+    Close();
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(EventCacheHeader))
+    {
+      close(fd);
+      return false;
+    }
+    void* region = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); //The mapping stays valid without the descriptor
+    if (region == MAP_FAILED) return false;
+    mapped = (const char*)region;
+    mappedSize = info.st_size;
+    madvise(region, mappedSize, MADV_SEQUENTIAL);
+
+    header = (const EventCacheHeader*)mapped;
+    //Every column has to lie past the header and inside the file, or a damaged cache is read out of bounds
+    Long64_t nEvents = header->nEvents, nSegments = header->nSegments;
+    auto columnFits = [&](Long64_t offset, Long64_t count, Long64_t width)
+    {
+      return offset >= (Long64_t)sizeof(EventCacheHeader) && offset <= mappedSize
+        && count <= (mappedSize - offset) / width;
+    };
+    bool ok = memcmp(header->magic, EVENT_CACHE_MAGIC, 8) == 0
+      && header->version == EVENT_CACHE_VERSION
+      && header->headerSize == sizeof(EventCacheHeader)
+      && header->sourceSize == sourceSize
+      && header->sourceMtime == sourceMtime
+      && nEvents >= 0 && nSegments >= 0 && (nEvents == 0 || nSegments > 0)
+      && columnFits(header->multipOffset, nEvents, sizeof(Short_t))
+      && columnFits(header->coinOffset, nEvents, sizeof(UChar_t))
+      && columnFits(header->qdcOffset, nEvents, 32 * sizeof(UShort_t))
+      && columnFits(header->threshOffset, nEvents, 32 * sizeof(UShort_t))
+      && columnFits(header->segmentOffset, nSegments, sizeof(EventCacheSegment));
+    if (!ok)
+    {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void Close()
+  {
+    if (mapped != nullptr) munmap((void*)mapped, mappedSize);
+    mapped = nullptr;
+    mappedSize = 0;
+    header = nullptr;
+  }
+
+  Long64_t GetEntries() const {return header->nEvents;}
+  Long64_t GetSegments() const {return header->nSegments;}
+  Long64_t GetBytes() const {return mappedSize;}
+
+  const Short_t* Multip() const {return (const Short_t*)(mapped + header->multipOffset);}
+  const UChar_t* Coin() const {return (const UChar_t*)(mapped + header->coinOffset);}
+  const UShort_t* QDC() const {return (const UShort_t*)(mapped + header->qdcOffset);}
+  const UShort_t* Thresh() const {return (const UShort_t*)(mapped + header->threshOffset);}
+  const EventCacheSegment* Segments() const {return (const EventCacheSegment*)(mapped + header->segmentOffset);}
+
+private:
+  const char* mapped;
+  Long64_t mappedSize;
+  const EventCacheHeader* header;
+
+  VetoEventCache(const VetoEventCache&);
+  VetoEventCache& operator=(const VetoEventCache&);
+};
+
+//-------------------------------------------------------------------------------------------------------------------------
+// Reads entries [firstEntry, lastEntry) of a mapped cache
+class CacheEventSource
+{
+public:
+  CacheEventSource(const VetoEventCache& cache, Long64_t firstEntry, Long64_t lastEntry)
+    : cache(cache), entry(firstEntry), lastEntry(lastEntry), segment(FindSegment(firstEntry)), nRead(0)
+  {
+  }
+
+  // Unpack the next entry's columns into ev, widening the 16 bit QDCs and thresholds
+  bool Next(VetoEventRow& ev)
+  {
+    if (entry >= lastEntry) return false;
+    const EventCacheSegment* segments = cache.Segments();
+    while (segment + 1 < cache.GetSegments() && segments[segment + 1].firstEntry <= entry) segment++;
+
+    ev.run = segments[segment].run;
+    ev.start = segments[segment].start;
+    ev.scalerDuration = segments[segment].scalerDuration;
+    ev.fMultip = cache.Multip()[entry];
+    UChar_t coin = cache.Coin()[entry];
+    for (int k = 0; k < 4; k++) ev.CoinType[k] = (coin >> k) & 1;
+    const UShort_t* qdc = cache.QDC() + entry * 32;
+    const UShort_t* thresh = cache.Thresh() + entry * 32;
+    for (int c = 0; c < 32; c++)
+    {
+      ev.fQDC[c] = qdc[c];
+      ev.fSWThresh[c] = thresh[c];
+    }
+    entry++;
+    nRead++;
+    return true;
+  }
+
+  // Jump to one entry, for passes that only read the entries listed in an index
+  bool ReadEntry(Long64_t entry, VetoEventRow& ev)
+  {
+    if (entry < cache.Segments()[segment].firstEntry) segment = FindSegment(entry); //Forward jumps are walked in Next()
+    this->entry = entry;
+    return Next(ev);
+  }
+
+  // Bytes of the event columns read so far
+  Long64_t GetBytesRead() const {return nRead * (Long64_t)(sizeof(Short_t) + sizeof(UChar_t) + 64 * sizeof(UShort_t));}
+
+private:
+  // Segment holding an entry
+  Long64_t FindSegment(Long64_t target) const
+  {
+    const EventCacheSegment* segments = cache.Segments();
+    Long64_t lo = 0, hi = cache.GetSegments();
+    while (hi - lo > 1)
+    {
+      Long64_t mid = (lo + hi) / 2;
+      if (segments[mid].firstEntry <= target) lo = mid;
+      else hi = mid;
+    }
+    return lo;
+  }
+
+  const VetoEventCache& cache;
+  Long64_t entry;
+  Long64_t lastEntry;
+  Long64_t segment;
+  Long64_t nRead; //Events read, for GetBytesRead()
+};
+
+//-------------------------------------------------------------------------------------------------------------------------
+// Convert a skim into a cache file. Fails, leaving no cache behind, if any value does not fit its
+// packed column, since then the cache could not reproduce the skim exactly.
+bool buildEventCache(const string& sourcePath, const string& cachePath)
+{
+  Long64_t sourceSize = 0, sourceMtime = 0;
+  if (!fileStamp(sourcePath, sourceSize, sourceMtime)) return false;
+
+  Long64_t nEvents = 0;
+  {
+    unique_ptr<TFile> file(TFile::Open(sourcePath.c_str()));
+    if (!file) return false;
+    TTree* vetoTree = nullptr;
+    file->GetObject("vetoTree", vetoTree);
+    if (vetoTree == nullptr) return false;
+    nEvents = vetoTree->GetEntries();
+  }
+
+  EventCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, EVENT_CACHE_MAGIC, 8);
+  header.version = EVENT_CACHE_VERSION;
+  header.headerSize = sizeof(EventCacheHeader);
+  header.sourceSize = sourceSize;
+  header.sourceMtime = sourceMtime;
+  header.nEvents = nEvents;
+  header.multipOffset = alignCacheOffset(sizeof(EventCacheHeader));
+  header.coinOffset = alignCacheOffset(header.multipOffset + nEvents * sizeof(Short_t));
+  header.qdcOffset = alignCacheOffset(header.coinOffset + nEvents * sizeof(UChar_t));
+  header.threshOffset = alignCacheOffset(header.qdcOffset + nEvents * 32 * sizeof(UShort_t));
+  header.segmentOffset = alignCacheOffset(header.threshOffset + nEvents * 32 * sizeof(UShort_t));
+
+  FILE* out = fopen(tmpPathFor(cachePath).c_str(), "wb");
+  if (out == nullptr) return false;
+
+  //Events are packed a block at a time, each column block written at its place in the file
+  const Long64_t blockSize = 65536;
+  vector<Short_t> multip;
+  vector<UChar_t> coin;
+  vector<UShort_t> qdc;
+  vector<UShort_t> thresh;
+  vector<EventCacheSegment> segments;
+  multip.reserve(blockSize);
+  coin.reserve(blockSize);
+  qdc.reserve(blockSize * 32);
+  thresh.reserve(blockSize * 32);
+
+  bool ok = true;
+  Long64_t blockFirst = 0;
+  auto writeAt = [&](Long64_t offset, const void* data, size_t bytes)
+  {
+    if (bytes == 0) return;
+    ok = ok && fseeko(out, offset, SEEK_SET) == 0 && fwrite(data, 1, bytes, out) == bytes;
+  };
+  auto flushBlock = [&]()
+  {
+    writeAt(header.multipOffset + blockFirst * sizeof(Short_t), multip.data(), multip.size() * sizeof(Short_t));
+    writeAt(header.coinOffset + blockFirst * sizeof(UChar_t), coin.data(), coin.size() * sizeof(UChar_t));
+    writeAt(header.qdcOffset + blockFirst * 32 * sizeof(UShort_t), qdc.data(), qdc.size() * sizeof(UShort_t));
+    writeAt(header.threshOffset + blockFirst * 32 * sizeof(UShort_t), thresh.data(), thresh.size() * sizeof(UShort_t));
+    blockFirst += multip.size();
+    multip.clear();
+    coin.clear();
+    qdc.clear();
+    thresh.clear();
+  };
+
+  {
+    TreeEventSource source(sourcePath, 0, nEvents);
+    VetoEventRow ev;
+    Long64_t entry = 0;
+    while (ok && source.Next(ev))
+    {
+      if (segments.empty() || ev.run != segments.back().run || ev.start != segments.back().start
+          || memcmp(&ev.scalerDuration, &segments.back().scalerDuration, sizeof(double)) != 0)
+      {
+        EventCacheSegment seg = {entry, ev.start, ev.scalerDuration, ev.run, 0};
+        segments.push_back(seg);
+      }
+
+      if (ev.fMultip < -32768 || ev.fMultip > 32767)
+      {
+        cout << "Event cache: fMultip " << ev.fMultip << " at entry " << entry << " does not fit 16 bits" << endl;
+        ok = false;
+      }
+      multip.push_back((Short_t)ev.fMultip);
+      coin.push_back((ev.CoinType[0] ? 1 : 0) | (ev.CoinType[1] ? 2 : 0) | (ev.CoinType[2] ? 4 : 0) | (ev.CoinType[3] ? 8 : 0));
+      for (int c = 0; c < 32; c++)
+      {
+        if (ev.fQDC[c] < 0 || ev.fQDC[c] > 65535 || ev.fSWThresh[c] < 0 || ev.fSWThresh[c] > 65535)
+        {
+          cout << "Event cache: channel " << c << " at entry " << entry << " does not fit 16 bits" << endl;
+          ok = false;
+        }
+        qdc.push_back((UShort_t)ev.fQDC[c]);
+        thresh.push_back((UShort_t)ev.fSWThresh[c]);
+      }
+
+      entry++;
+      if ((Long64_t)multip.size() == blockSize) flushBlock();
+    }
+    ok = ok && (entry == nEvents);
+  }
+  flushBlock();
+
+  header.nSegments = segments.size();
+  writeAt(header.segmentOffset, segments.data(), segments.size() * sizeof(EventCacheSegment));
+  writeAt(0, &header, sizeof(header)); //Header last, so a half written file never looks valid
+  ok = (fclose(out) == 0) && ok;
+
+  //Renamed into place so another set never maps a half written cache
+  return commitTmpFile(cachePath, ok);
+}
+
+// Map the cache for a skim, building it first if it is missing or stale (unless buildIfStale is false)
+bool openEventCache(const string& sourcePath, VetoEventCache& cache, bool buildIfStale = true)
+{
+  Long64_t sourceSize = 0, sourceMtime = 0;
+  if (!fileStamp(sourcePath, sourceSize, sourceMtime)) return false;
+
+  string cachePath = sidecarPathFor(sourcePath, EVENT_CACHE_EXTENSION);
+  if (cache.Open(cachePath, sourceSize, sourceMtime)) return true;
+  if (!buildIfStale) return false;
+
+  cout << "Building event cache " << cachePath << endl;
+  if (!buildEventCache(sourcePath, cachePath))
+  {
+    cout << "Could not build event cache " << cachePath << ", reading the tree instead" << endl;
+    return false;
+  }
+  return cache.Open(cachePath, sourceSize, sourceMtime);
+}
+
+//-------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,275 @@
+//
+// vetoQDCFit.h
+//
+// used by vetoAnaCaster.h
+//
+// Landau fits of the threshold cut QDC histograms, done apart from drawing them. The channels are fit
+// at once on several threads, each with a function and a fitter of its own, and every fit is remembered under a
+// hash of the histogram it was made on, in a cache file kept between passes. A histogram that is
+// plotted again unchanged (a re-plot, or a set that didn't grow) is never fit twice. The file only
+// keeps the fits the last plot stage used, so it stays the size of one cast's histograms.
+//
+//-------------------------------------------------------------------------------------------------------------------------
+
+#include "TH1F.h"
+#include "TF1.h"
+#include "TList.h"
+#include "Fit/Fitter.h"
+#include "Fit/BinData.h"
+#include "HFitInterface.h"
+#include "Math/WrappedMultiTF1.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+const string QDC_FIT_CACHE_FILE_NAME = "qdc-fit-cache.txt";
+
+struct QDCFit
+{
+  int status; //The fit status, as TH1::Fit would return it: 0 for a good fit, -1 when the histogram was empty and not fit
+  double par[3]; //landau constant, MPV, sigma
+  double err[3];
+  double chi2;
+  int ndf;
+};
+
+// 64 bit FNV-1a hash of a histogram's binning, contents and errors, the key fits are cached under
+ULong64_t histHash(const TH1* h)
+{
+  ULong64_t hash = 14695981039346656037ULL;
+  auto add = [&hash](double value)
+  {
+    unsigned char bytes[sizeof(double)];
+    memcpy(bytes, &value, sizeof(double));
+    for (size_t b = 0; b < sizeof(double); b++)
+    {
+      hash ^= bytes[b];
+      hash *= 1099511628211ULL;
+    }
+  };
+  int nBins = h->GetNbinsX();
+  add(nBins);
+  add(h->GetXaxis()->GetXmin());
+  add(h->GetXaxis()->GetXmax());
+  for (int b = 0; b <= nBins + 1; b++)
+  {
+    add(h->GetBinContent(b));
+    add(h->GetBinError(b));
+  }
+  return hash;
+}
+
+// Fits by histogram hash, read from and saved to a text file, one fit a line:
+//   hash status par0 par1 par2 err0 err1 err2 chi2 ndf
+// Save() drops the fits that were neither found nor added since Load(), those of histograms that have
+// since changed or are no longer plotted
+class FitCache
+{
+public:
+  FitCache() : changed(false) {}
+
+  // Read the fits saved before, if there are any
+  void Load(const string& path)
+  {
+    ifstream input(path.c_str());
+    string line;
+    while (getline(input, line))
+    {
+      istringstream fields(line);
+      ULong64_t hash;
+      QDCFit fit;
+      if (fields >> hex >> hash >> dec >> fit.status >> fit.par[0] >> fit.par[1] >> fit.par[2]
+                 >> fit.err[0] >> fit.err[1] >> fit.err[2] >> fit.chi2 >> fit.ndf)
+      {
+        fits[hash] = fit;
+      }
+    }
+  }
+
+  // Write the used fits out if any were added or are to be dropped, false if they could not be
+  bool Save(const string& path)
+  {
+    if (!changed && used.size() == fits.size()) return true;
+    string tmpPath = path + ".tmp";
+    FILE* out = fopen(tmpPath.c_str(), "w");
+    if (out == nullptr) return false;
+    for (map<ULong64_t, QDCFit>::const_iterator i = fits.begin(); i != fits.end(); i++)
+    {
+      if (used.count(i->first) == 0) continue;
+      const QDCFit& fit = i->second;
+      fprintf(out, "%016llx %d %.17g %.17g %.17g %.17g %.17g %.17g %.17g %d\n", (unsigned long long)i->first, fit.status,
+              fit.par[0], fit.par[1], fit.par[2], fit.err[0], fit.err[1], fit.err[2], fit.chi2, fit.ndf);
+    }
+    bool ok = (fclose(out) == 0) && rename(tmpPath.c_str(), path.c_str()) == 0;
+    if (ok) changed = false;
+    return ok;
+  }
+
+  bool Find(ULong64_t hash, QDCFit& fit)
+  {
+    map<ULong64_t, QDCFit>::const_iterator i = fits.find(hash);
+    if (i == fits.end()) return false;
+    fit = i->second;
+    used.insert(hash);
+    return true;
+  }
+
+  void Insert(ULong64_t hash, const QDCFit& fit)
+  {
+    fits[hash] = fit;
+    used.insert(hash);
+    changed = true;
+  }
+
+private:
+  map<ULong64_t, QDCFit> fits;
+  set<ULong64_t> used; //Found or added since Load(), the fits Save() keeps
+  bool changed;
+};
+
+// The chi2 landau fit TH1::Fit(f, "Q N 0") makes, done through a ROOT::Fit::Fitter of its own. TH1::Fit goes
+// through TVirtualFitter::GetFitter() and the process's default minimizer, both global, so it is not safe on
+// several threads at once; this touches nothing but h (read only) and f. The fitter uses Minuit2, which keeps
+// its state per fit, and the start values are the ones TH1::Fit gives a landau
+int fitLandau(const TH1F* h, TF1* f)
+{
+  ROOT::Fit::DataOptions options; //Empty bins left out, errors from the bins, as TH1::Fit does
+  ROOT::Fit::DataRange range(h->GetXaxis()->GetXmin(), h->GetXaxis()->GetXmax());
+  ROOT::Fit::BinData data(options, range);
+  ROOT::Fit::FillData(data, h);
+  if (data.Size() == 0) return -1;
+  ROOT::Fit::InitGaus(data, f);
+
+  ROOT::Math::WrappedMultiTF1 model(*f, 1);
+  ROOT::Fit::Fitter fitter;
+  fitter.Config().SetMinimizer("Minuit2");
+  fitter.SetFunction(model, false);
+  fitter.Fit(data);
+
+  const ROOT::Fit::FitResult& result = fitter.Result();
+  if (result.NPar() == 3)
+  {
+    f->SetParameters(result.GetParams());
+    f->SetParErrors(result.GetErrors());
+    f->SetChisquare(result.Chi2());
+    f->SetNDF(result.Ndf());
+  }
+  return result.Status();
+}
+
+// Landau fit every one of n histograms, taking what it can from the cache and fitting the rest
+// on up to nThreads threads with fitLandau(). ROOT::EnableThreadSafety() must have been called for more than one
+void fitQDCs(TH1F* const hists[], int n, FitCache& cache, QDCFit fits[], int nThreads)
+{
+  vector<int> toFit;
+  vector<ULong64_t> hashes(n);
+  for (int c = 0; c < n; c++)
+  {
+    hashes[c] = histHash(hists[c]);
+    if (hists[c]->GetEntries() == 0)
+    {
+      memset(&fits[c], 0, sizeof(QDCFit));
+      fits[c].status = -1;
+    }
+    else if (!cache.Find(hashes[c], fits[c]))
+    {
+      toFit.push_back(c);
+    }
+  }
+  if (toFit.empty()) return;
+
+  //Making functions parses formulas, so it is done here and only the fits run on the threads.
+  //They stay out of gROOT's list of functions, so nothing global is touched while fitting
+  vector<TF1*> functions(toFit.size());
+  for (size_t k = 0; k < toFit.size(); k++)
+  {
+    TH1F* h = hists[toFit[k]];
+    functions[k] = new TF1(("qdcFit" + to_string(toFit[k])).c_str(), "landau", h->GetXaxis()->GetXmin(), h->GetXaxis()->GetXmax(), TF1::EAddToList::kNo);
+  }
+
+  atomic<size_t> next(0);
+  auto fitWorker = [&]()
+  {
+    for (size_t k = next++; k < toFit.size(); k = next++)
+    {
+      int c = toFit[k];
+      TF1* f = functions[k];
+      QDCFit& fit = fits[c];
+      fit.status = fitLandau(hists[c], f); //The histogram is left without the function
+      for (int p = 0; p < 3; p++)
+      {
+        fit.par[p] = f->GetParameter(p);
+        fit.err[p] = f->GetParError(p);
+      }
+      fit.chi2 = f->GetChisquare();
+      fit.ndf = f->GetNDF();
+    }
+  };
+  int nWorkers = max(1, min(nThreads, (int)toFit.size()));
+  vector<thread> workers;
+  for (int w = 1; w < nWorkers; w++)
+  {
+    workers.push_back(thread(fitWorker));
+  }
+  fitWorker();
+  for (size_t w = 0; w < workers.size(); w++)
+  {
+    workers[w].join();
+  }
+
+  for (size_t k = 0; k < toFit.size(); k++)
+  {
+    cache.Insert(hashes[toFit[k]], fits[toFit[k]]);
+    delete functions[k];
+  }
+}
+
+// Hang a fit on its histogram as the "landau" function, so it is drawn with it and shown in the fit box
+// just as if the histogram had been fit itself
+void attachQDCFit(TH1F* h, const QDCFit& fit)
+{
+  TList* functions = h->GetListOfFunctions();
+  TObject* old = functions->FindObject("landau");
+  if (old != nullptr)
+  {
+    functions->Remove(old);
+    delete old;
+  }
+  if (fit.status == -1) return;
+
+  TF1* f = new TF1("landau", "landau", h->GetXaxis()->GetXmin(), h->GetXaxis()->GetXmax(), TF1::EAddToList::kNo);
+  for (int p = 0; p < 3; p++)
+  {
+    f->SetParameter(p, fit.par[p]);
+    f->SetParError(p, fit.err[p]);
+  }
+  f->SetChisquare(fit.chi2);
+  f->SetNDF(fit.ndf);
+  functions->Add(f); //Owned by the histogram from here on
+}
+
+// One line per channel: channel entries status mpv mpvErr sigma sigmaErr chi2 ndf
+bool writeQDCFits(const string& path, TH1F* const hists[], const QDCFit fits[], int n)
+{
+  ofstream output(path.c_str(), ios::out | ios::trunc);
+  if (!output) return false;
+  for (int c = 0; c < n; c++)
+  {
+    output << c << " " << hists[c]->GetEntries() << " " << fits[c].status << " " << fits[c].par[1] << " " << fits[c].err[1]
+           << " " << fits[c].par[2] << " " << fits[c].err[2] << " " << fits[c].chi2 << " " << fits[c].ndf << '\n';
+  }
+  output.close();
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,198 @@
+//
+// vetoRateSeries.h
+//
+// used by vetoAnaCaster.C
+//
+// Four-panel counts and live time binned in fixed width buckets of UTC time. Runs are added one at a
+// time as ana() replays them and go into the bucket holding their start, so a series is built in one
+// pass with no libc time calls, and series of several sets can be merged into one.
+//
+//-------------------------------------------------------------------------------------------------------------------------
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+
+using namespace std;
+
+const Long64_t RATE_BUCKET_HOUR = 3600;
+const Long64_t RATE_BUCKET_DAY = 86400;
+const Long64_t RATE_BUCKET_WEEK = 7 * 86400;
+
+// Days since 1970-01-01 to a date, Howard Hinnant's civil_from_days. Correct for any day, before 1970 as well
+void civilFromDays(Long64_t days, int& year, int& month, int& day)
+{
+  days += 719468; //Count from 0000-03-01, so the leap day is the last day of a year
+  Long64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  Long64_t dayOfEra = days - era * 146097;
+  Long64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  Long64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  Long64_t monthFromMarch = (5 * dayOfYear + 2) / 153;
+  day = dayOfYear - (153 * monthFromMarch + 2) / 5 + 1;
+  month = monthFromMarch < 10 ? monthFromMarch + 3 : monthFromMarch - 9;
+  year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+}
+
+// Floor of a / b for b > 0, rounding down for negative a too
+Long64_t floorDiv(Long64_t a, Long64_t b)
+{
+  return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+// "2017-05-04 13:00:00 UTC", for printing unix times without localtime()
+string formatUTC(Long64_t unixTime)
+{
+  Long64_t days = floorDiv(unixTime, 86400);
+  Long64_t seconds = unixTime - days * 86400;
+  int year, month, day;
+  civilFromDays(days, year, month, day);
+  char text[40];
+  snprintf(text, sizeof(text), "%04d-%02d-%02d %02d:%02d:%02d UTC", year, month, day,
+           (int)(seconds / 3600), (int)(seconds / 60 % 60), (int)(seconds % 60));
+  return text;
+}
+
+struct RateBucket
+{
+  Long64_t index; //Bucket number, counted from the series origin
+  double liveTime; //Summed scalerDuration of the runs starting in the bucket
+  Long64_t count; //Four-panel events of those runs
+};
+
+class RateSeries
+{
+public:
+  // utcOffset is added to unix times before bucketing, e.g. -7 * 3600 for days starting at midnight MST.
+  // Weeks start on Monday
+  RateSeries(Long64_t width = RATE_BUCKET_DAY, Long64_t utcOffset = 0)
+    : width(width), utcOffset(utcOffset), weekShift(width == RATE_BUCKET_WEEK ? -3 * 86400 : 0) {} //1970-01-01 was a Thursday
+
+  // Add live time and counts at a unix time. In order additions only ever touch the last bucket
+  void Add(Long64_t time, double liveTime, Long64_t count)
+  {
+    RateBucket& bucket = BucketAt(IndexOf(time));
+    bucket.liveTime += liveTime;
+    bucket.count += count;
+  }
+
+  // Add a bucket of another series of the same width and offset
+  void AddBucket(const RateBucket& other)
+  {
+    RateBucket& bucket = BucketAt(other.index);
+    bucket.liveTime += other.liveTime;
+    bucket.count += other.count;
+  }
+
+  // Add another series of the same width and offset, bucket by bucket
+  void Merge(const RateSeries& other)
+  {
+    for (size_t i = 0; i < other.buckets.size(); i++)
+    {
+      AddBucket(other.buckets[i]);
+    }
+  }
+
+  // Add a series of another width or offset, each of its buckets into the bucket here that holds it whole.
+  // False, with nothing added, if any of them would straddle two buckets here (e.g. days into hours)
+  bool MergeRebucketed(const RateSeries& other)
+  {
+    for (size_t i = 0; i < other.buckets.size(); i++)
+    {
+      Long64_t start = other.BucketStart(other.buckets[i]);
+      if (IndexOf(start) != IndexOf(start + other.width - 1)) return false;
+    }
+    for (size_t i = 0; i < other.buckets.size(); i++)
+    {
+      Add(other.BucketStart(other.buckets[i]), other.buckets[i].liveTime, other.buckets[i].count);
+    }
+    return true;
+  }
+
+  // Only buckets that something was added to are kept, in time order
+  size_t GetBuckets() const {return buckets.size();}
+  const RateBucket& GetBucket(size_t i) const {return buckets[i];}
+  Long64_t GetWidth() const {return width;}
+  Long64_t GetUTCOffset() const {return utcOffset;}
+
+  // Unix time the bucket starts at
+  Long64_t BucketStart(const RateBucket& bucket) const {return bucket.index * width + weekShift - utcOffset;}
+
+  // Date and hour of the start of a bucket, on the clock of utcOffset
+  void BucketDate(const RateBucket& bucket, int& year, int& month, int& day, int& hour) const
+  {
+    Long64_t local = bucket.index * width + weekShift;
+    Long64_t days = floorDiv(local, 86400);
+    civilFromDays(days, year, month, day);
+    hour = (local - days * 86400) / 3600;
+  }
+
+private:
+  Long64_t IndexOf(Long64_t time) const {return floorDiv(time + utcOffset - weekShift, width);}
+
+  RateBucket& BucketAt(Long64_t index)
+  {
+    if (buckets.empty() || index > buckets.back().index)
+    {
+      RateBucket bucket = {index, 0., 0};
+      buckets.push_back(bucket);
+      return buckets.back();
+    }
+    vector<RateBucket>::iterator it = lower_bound(buckets.begin(), buckets.end(), index,
+                                                  [](const RateBucket& b, Long64_t i) {return b.index < i;});
+    if (it == buckets.end() || it->index != index)
+    {
+      RateBucket bucket = {index, 0., 0};
+      it = buckets.insert(it, bucket);
+    }
+    return *it;
+  }
+
+  Long64_t width;
+  Long64_t utcOffset;
+  Long64_t weekShift;
+  vector<RateBucket> buckets;
+};
+
+// Write a series one bucket a line:
+//   start (unix) year month day hour count liveTime rate rateErr [windowRate windowRateErr]
+// The window columns are written when window > 0 and hold the rate over the buckets in the last
+// window bucket widths up to and including this one. Rates are 0 where there is no live time.
+bool writeRateSeries(const string& path, const RateSeries& series, int window)
+{
+  ofstream output(path.c_str(), ios::out | ios::trunc);
+  if (!output) return false;
+
+  size_t first = 0; //First bucket inside the window
+  for (size_t i = 0; i < series.GetBuckets(); i++)
+  {
+    const RateBucket& bucket = series.GetBucket(i);
+    int year, month, day, hour;
+    series.BucketDate(bucket, year, month, day, hour);
+    double rate = (bucket.liveTime > 0) ? bucket.count / bucket.liveTime : 0.;
+    double rateErr = (bucket.liveTime > 0) ? sqrt((double)bucket.count) / bucket.liveTime : 0.;
+    output << series.BucketStart(bucket) << " " << year << " " << month << " " << day << " " << hour << " "
+           << bucket.count << " " << bucket.liveTime << " " << rate << " " << rateErr;
+
+    if (window > 0)
+    {
+      while (series.GetBucket(first).index <= bucket.index - window) first++;
+      double windowLiveTime = 0.; //Summed afresh each time, a running sum would drift as buckets leave
+      Long64_t windowCount = 0;
+      for (size_t j = first; j <= i; j++)
+      {
+        windowLiveTime += series.GetBucket(j).liveTime;
+        windowCount += series.GetBucket(j).count;
+      }
+      double windowRate = (windowLiveTime > 0) ? windowCount / windowLiveTime : 0.;
+      double windowRateErr = (windowLiveTime > 0) ? sqrt((double)windowCount) / windowLiveTime : 0.;
+      output << " " << windowRate << " " << windowRateErr;
+    }
+    output << '\n';
+  }
+  output.close();
+  return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,60 @@
+//
+// vetoSidecar.h
+//
+// used by vetoEventCache.h, vetoEntryIndex.h and vetoAnaCaster.C
+//
+// Sidecar files are kept next to a skim and named after it (the event cache, the entry index and the
+// incremental state). Each is written to a .tmp file first and renamed into place once it is whole, so
+// a set reading it at the same time, or a pass after a crash, never sees half a file.
+//
+//-------------------------------------------------------------------------------------------------------------------------
+
+#include <string>
+#include <cstdio>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+// skimVeto_P3LTPNz.root, ".vcache" -> skimVeto_P3LTPNz.vcache
+string sidecarPathFor(const string& sourcePath, const string& extension)
+{
+  string base = sourcePath;
+  if (base.size() > 5 && base.compare(base.size() - 5, 5, ".root") == 0) base.erase(base.size() - 5);
+  return base + extension;
+}
+
+// Size and modification time of a file, false if it can't be read
+bool fileStamp(const string& path, Long64_t& size, Long64_t& mtime)
+{
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) return false;
+  size = info.st_size;
+  mtime = info.st_mtime;
+  return true;
+}
+
+string tmpPathFor(const string& path) {return path + ".tmp";}
+
+// Move a finished path.tmp over path when written is true, otherwise (or if the rename fails) remove it
+bool commitTmpFile(const string& path, bool written)
+{
+  string tmpPath = tmpPathFor(path);
+  bool ok = written && rename(tmpPath.c_str(), path.c_str()) == 0;
+  if (!ok) remove(tmpPath.c_str());
+  return ok;
+}
+
+// Write a file through path.tmp. write(FILE*) fills it and returns false on any error; the file only
+// replaces path if that and closing it went well
+template <class Write>
+bool writeFileAtomically(const string& path, Write write)
+{
+  FILE* out = fopen(tmpPathFor(path).c_str(), "wb");
+  if (out == nullptr) return false;
+  bool ok = write(out);
+  ok = (fclose(out) == 0) && ok;
+  return commitTmpFile(path, ok);
+}
+
+//-------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,177 @@
+//
+// vetoStageStats.h
+//
+// used by vetoAnaCaster.C
+//
+// Where the time of a cast goes, stage by stage. Whole stages (plotting, writing the outputs) are timed
+// with a StageTimer around them. The stages inside the event loop (reading, classifying, filling) are
+// too short to time every event without slowing it down, so one event in STAGE_SAMPLE_EVERY is timed
+// and the sampled times are scaled up to all the events.
+// Only time is split by stage. Every byte counted is read by the event sources, so bytes read belong to
+// the I/O stage and are reported on its line. Events/s is over the whole event loop, and peak RSS is
+// the process's high water mark once the set is saved; neither is broken down by stage.
+//
+//-------------------------------------------------------------------------------------------------------------------------
+
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <cstdio>
+
+#include <sys/resource.h>
+
+using namespace std;
+
+enum VetoStage
+{
+  STAGE_IO, //Opening the skim and reading events
+  STAGE_CLASSIFY, //Hit masks, coincidence classes and multiplicity cuts
+  STAGE_FILL, //Histogram fills and multip table rows
+  STAGE_PLOT, //Fits, canvases and PDFs
+  STAGE_OUTPUT, //Text, table, state and partial result files
+  N_STAGES
+};
+
+const char* const STAGE_NAMES[N_STAGES] = {"I/O", "classify", "fill", "plot/fit", "output"};
+
+const int STAGE_SAMPLE_EVERY = 64; //One event in this many is timed
+
+// Seconds on a steady clock, for differences only
+double stageClock()
+{
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Peak resident memory of the whole process so far, in kB
+long peakRSSKB()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024; //Bytes on macOS
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+struct StageStats
+{
+  double seconds[N_STAGES]; //Timed stages, plus the event stages once Finish() has scaled them up
+  double sampledSeconds[N_STAGES]; //Event stages of the sampled events only
+  Long64_t events; //Events read
+  Long64_t sampledEvents;
+  Long64_t bytesRead; //From the skim or its cache, all in STAGE_IO
+  double loopSeconds; //Wall time of the event loop, all of its threads together
+  double wallSeconds; //Wall time of the whole set
+  long peakRSS; //kB, the whole process's peak so far
+
+  StageStats() {Clear();}
+
+  void Clear()
+  {
+    for (int s = 0; s < N_STAGES; s++) seconds[s] = sampledSeconds[s] = 0.;
+    events = sampledEvents = bytesRead = 0;
+    loopSeconds = wallSeconds = 0.;
+    peakRSS = 0;
+  }
+
+  // Scale the sampled event stages up to every event
+  void Finish()
+  {
+    double scale = (sampledEvents > 0) ? (double)events / sampledEvents : 0.;
+    for (int s = STAGE_IO; s <= STAGE_FILL; s++)
+    {
+      seconds[s] += sampledSeconds[s] * scale;
+      sampledSeconds[s] = 0.;
+    }
+    sampledEvents = 0;
+  }
+
+  // Add another set's or chunk's stats. Wall times add, so merge sets cast one after another or chunks
+  // before Finish(), where only the sampled times and counts matter
+  void Merge(const StageStats& other)
+  {
+    for (int s = 0; s < N_STAGES; s++)
+    {
+      seconds[s] += other.seconds[s];
+      sampledSeconds[s] += other.sampledSeconds[s];
+    }
+    events += other.events;
+    sampledEvents += other.sampledEvents;
+    bytesRead += other.bytesRead;
+    loopSeconds += other.loopSeconds;
+    wallSeconds += other.wallSeconds;
+    peakRSS = max(peakRSS, other.peakRSS);
+  }
+};
+
+// Times the scope it is in into one stage. Does nothing without stats
+class StageTimer
+{
+public:
+  StageTimer(StageStats* stats, VetoStage stage) : stats(stats), stage(stage), begin(stats ? stageClock() : 0.) {}
+  ~StageTimer() {if (stats) stats->seconds[stage] += stageClock() - begin;}
+
+private:
+  StageStats* stats;
+  VetoStage stage;
+  double begin;
+};
+
+// Times the stages of sampled events inside the event loop: Begin() before reading an event, then
+// Mark(stage) at the end of each stretch of work, which is booked to that stage.
+// With enabled false every call is empty, so a loop built that way carries no timing code at all.
+template <bool enabled>
+class StageSampler
+{
+public:
+  StageSampler(StageStats* stats) : stats(stats), count(0), sampled(false), last(0.) {}
+
+  void Begin()
+  {
+    if (!enabled) return;
+    sampled = (count++ % STAGE_SAMPLE_EVERY == 0);
+    if (sampled) last = stageClock();
+  }
+
+  void Mark(VetoStage stage)
+  {
+    if (!enabled || !sampled) return;
+    double now = stageClock();
+    stats->sampledSeconds[stage] += now - last;
+    last = now;
+  }
+
+  // Count a whole event, after its last Mark()
+  void End()
+  {
+    if (!enabled) return;
+    stats->events++;
+    if (sampled) stats->sampledEvents++;
+  }
+
+private:
+  StageStats* stats;
+  Long64_t count;
+  bool sampled;
+  double last;
+};
+
+void printStageStats(const string& name, const StageStats& stats)
+{
+  double total = 0.;
+  for (int s = 0; s < N_STAGES; s++) total += stats.seconds[s];
+  cout << "----- Stage breakdown: " << name << " -----" << endl;
+  for (int s = 0; s < N_STAGES; s++)
+  {
+    char line[120];
+    snprintf(line, sizeof(line), "%-10s %10.3f s  %5.1f%%", STAGE_NAMES[s], stats.seconds[s], total > 0 ? 100. * stats.seconds[s] / total : 0.);
+    cout << line;
+    if (s == STAGE_IO) cout << "  " << stats.bytesRead << " bytes read";
+    cout << endl;
+  }
+  cout << "events: " << stats.events << "  events/s over the event loop: " << (stats.loopSeconds > 0 ? stats.events / stats.loopSeconds : 0.) << endl;
+  cout << "process peak RSS: " << stats.peakRSS << " kB  wall: " << stats.wallSeconds << " s" << endl;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------
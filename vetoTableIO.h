@@ -0,0 +1,284 @@
+//
+// vetoTableIO.h
+//
+// used by vetoAnaCaster.C and vetoTableTest.C
+//
+// Buffered writing and reading of tables of integers, like the run/multiplicity table. A table is
+// written either as text, one row a line with the columns separated by spaces, or in a compact binary
+// form. Rows go into a large buffer that is written out whole, so a table can be streamed out as it
+// is filled instead of being held in memory.
+//
+//-------------------------------------------------------------------------------------------------------------------------
+
+#include <string>
+#include <vector>
+#include <set>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// Binary table layout, native byte order:
+//   TableHeader
+//   nRows rows, each column of a row as a varint of the zigzag coded difference from the same column
+//   of the row before (from 0 for the first row)
+// Several binary tables may be concatenated into one file, as the parts of a table are joined,
+// and read back as one table.
+
+const char TABLE_MAGIC[8] = {'M', 'J', 'D', 'V', 'E', 'T', 'O', 'T'};
+const UInt_t TABLE_VERSION = 1;
+const size_t TABLE_BUFFER_SIZE = 1 << 20; //Bytes held before a write
+
+struct TableHeader
+{
+  char magic[8];
+  UInt_t version;
+  UInt_t nColumns;
+  Long64_t nRows; //Filled in when the table is closed
+};
+
+class TableWriter
+{
+public:
+  TableWriter() : out(nullptr), nColumns(0), binary(false), ok(true) {memset(&header, 0, sizeof(header));}
+  ~TableWriter() {Close();}
+
+  bool Open(const string& path, int columns, bool binaryTable)
+  {
+    Close();
+    out = fopen(path.c_str(), "wb");
+    ok = (out != nullptr);
+    if (!ok) return false;
+    nColumns = columns;
+    binary = binaryTable;
+    buffer.clear();
+    buffer.reserve(TABLE_BUFFER_SIZE + 64 * nColumns);
+    previous.assign(nColumns, 0);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TABLE_MAGIC, 8);
+    header.version = TABLE_VERSION;
+    header.nColumns = nColumns;
+    if (binary) ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    return ok;
+  }
+
+  bool IsOpen() const {return out != nullptr;}
+
+  void Write(const Long64_t* row)
+  {
+    for (int c = 0; c < nColumns; c++)
+    {
+      if (binary)
+      {
+        Long64_t delta = (Long64_t)((ULong64_t)row[c] - (ULong64_t)previous[c]); //Wraps rather than overflows
+        PutVarint(((ULong64_t)delta << 1) ^ (ULong64_t)(delta >> 63));
+        previous[c] = row[c];
+      }
+      else
+      {
+        if (c > 0) buffer.push_back(' ');
+        PutText(row[c]);
+      }
+    }
+    if (!binary) buffer.push_back('\n');
+    header.nRows++;
+    if (buffer.size() >= TABLE_BUFFER_SIZE) Flush();
+  }
+
+  // Write what is left and close, false if anything could not be written
+  bool Close()
+  {
+    if (out == nullptr) return ok;
+    Flush();
+    if (binary && ok)
+    {
+      ok = fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+    }
+    ok = (fclose(out) == 0) && ok;
+    out = nullptr;
+    return ok;
+  }
+
+  Long64_t GetRows() const {return header.nRows;}
+
+private:
+  void Flush()
+  {
+    if (!buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) ok = false;
+    buffer.clear();
+  }
+
+  void PutVarint(ULong64_t value)
+  {
+    while (value >= 0x80)
+    {
+      buffer.push_back((char)(value | 0x80));
+      value >>= 7;
+    }
+    buffer.push_back((char)value);
+  }
+
+  void PutText(Long64_t value)
+  {
+    char digits[24];
+    int n = 0;
+    ULong64_t magnitude = (value < 0) ? 0 - (ULong64_t)value : (ULong64_t)value;
+    do
+    {
+      digits[n++] = '0' + magnitude % 10;
+      magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) buffer.push_back('-');
+    while (n > 0) buffer.push_back(digits[--n]);
+  }
+
+  FILE* out;
+  int nColumns;
+  bool binary;
+  bool ok;
+  TableHeader header;
+  vector<char> buffer;
+  vector<Long64_t> previous;
+};
+
+//-------------------------------------------------------------------------------------------------------------------------
+// Reads a table written by TableWriter, telling text from binary by the header
+class TableReader
+{
+public:
+  TableReader() : in(nullptr), nColumns(0), binary(false), rowsLeft(0), position(0) {}
+  ~TableReader() {Close();}
+
+  bool Open(const string& path, int columns)
+  {
+    Close();
+    in = fopen(path.c_str(), "rb");
+    if (in == nullptr) return false;
+    nColumns = columns;
+    buffer.clear();
+    position = 0;
+    rowsLeft = 0;
+    binary = Fill(8) && memcmp(&buffer[position], TABLE_MAGIC, 8) == 0;
+    return true;
+  }
+
+  void Close()
+  {
+    if (in != nullptr) fclose(in);
+    in = nullptr;
+  }
+
+  bool IsBinary() const {return binary;}
+
+  // The next row, false at the end of the table or on a damaged one
+  bool Next(Long64_t* row)
+  {
+    if (in == nullptr) return false;
+    return binary ? NextBinary(row) : NextText(row);
+  }
+
+private:
+  // Make sure n bytes past position are buffered, false if the file ends first
+  bool Fill(size_t n)
+  {
+    if (buffer.size() - position >= n) return true;
+    buffer.erase(buffer.begin(), buffer.begin() + position);
+    position = 0;
+    size_t have = buffer.size();
+    buffer.resize(have + max(n, TABLE_BUFFER_SIZE));
+    size_t got = fread(&buffer[have], 1, buffer.size() - have, in);
+    buffer.resize(have + got);
+    return buffer.size() >= n;
+  }
+
+  bool NextBinary(Long64_t* row)
+  {
+    while (rowsLeft == 0) //At the start of the file or of the next concatenated table
+    {
+      if (!Fill(sizeof(TableHeader))) return false;
+      TableHeader header;
+      memcpy(&header, &buffer[position], sizeof(header));
+      if (memcmp(header.magic, TABLE_MAGIC, 8) != 0 || header.version != TABLE_VERSION || (int)header.nColumns != nColumns) return false;
+      position += sizeof(header);
+      rowsLeft = header.nRows;
+      previous.assign(nColumns, 0);
+    }
+    for (int c = 0; c < nColumns; c++)
+    {
+      ULong64_t value = 0;
+      for (int shift = 0; ; shift += 7)
+      {
+        if (shift > 63 || !Fill(1)) return false;
+        unsigned char byte = buffer[position++];
+        value |= (ULong64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) break;
+      }
+      Long64_t delta = (Long64_t)(value >> 1) ^ -(Long64_t)(value & 1);
+      previous[c] = (Long64_t)((ULong64_t)previous[c] + (ULong64_t)delta);
+      row[c] = previous[c];
+    }
+    rowsLeft--;
+    return true;
+  }
+
+  bool NextText(Long64_t* row)
+  {
+    for (int c = 0; c < nColumns; c++)
+    {
+      while (Fill(1) && (buffer[position] == ' ' || buffer[position] == '\n' || buffer[position] == '\t' || buffer[position] == '\r')) position++;
+      if (!Fill(1)) return false;
+      bool negative = (buffer[position] == '-');
+      if (negative) position++;
+      if (!Fill(1) || buffer[position] < '0' || buffer[position] > '9') return false;
+      ULong64_t value = 0;
+      while (Fill(1) && buffer[position] >= '0' && buffer[position] <= '9')
+      {
+        value = value * 10 + (buffer[position++] - '0');
+      }
+      row[c] = negative ? -(Long64_t)value : (Long64_t)value;
+    }
+    return true;
+  }
+
+  FILE* in;
+  int nColumns;
+  bool binary;
+  Long64_t rowsLeft;
+  size_t position;
+  vector<char> buffer;
+  vector<Long64_t> previous;
+};
+
+// Append the whole of one file onto another, as when joining the parts of a table in order
+bool appendTableFile(const string& partPath, FILE* out)
+{
+  FILE* in = fopen(partPath.c_str(), "rb");
+  if (in == nullptr) return false;
+  vector<char> block(TABLE_BUFFER_SIZE);
+  bool ok = true;
+  size_t got;
+  while (ok && (got = fread(block.data(), 1, block.size(), in)) > 0)
+  {
+    ok = fwrite(block.data(), 1, got, out) == got;
+  }
+  fclose(in);
+  return ok;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------
+// A list of run numbers in the order they were first added, each listed once
+struct RunList
+{
+  vector<int> runs;
+  set<int> listed;
+
+  // Add a run unless it is listed already, true if it was added
+  bool Add(int run)
+  {
+    if (!listed.insert(run).second) return false;
+    runs.push_back(run);
+    return true;
+  }
+};
+
+//-------------------------------------------------------------------------------------------------------------------------